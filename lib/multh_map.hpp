@@ -4,48 +4,386 @@
 #include <vector>
 #include <utility>
 #include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <memory>
+#include <string>
+#include <string_view>
 #include <type_traits>
+#include <exception>
 
 
 // multithreading
 #include <mutex>
 #include <shared_mutex>
+#include <atomic>
+#include <thread>
+
+// memory mapped images (without mmap the image is read into memory)
+#if __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define MULTH_MAP_MMAP
+#endif
+
+// statistics (chain and probe lengths, lock contention) are only collected with MULTH_MAP_STATS defined
+//     (define it before the include, the same way in every translation unit)
+#ifdef MULTH_MAP_STATS
+#include <chrono>
+#endif
 
 // for debugging
 // #include <iostream>
 
 namespace multh {
     
+    // how a Map keeps its Data_Type
+    //     pointer: the caller hands over a heap allocated object, the map deletes it on erease
+    //     value:   small trivially copyable data is stored directly inside the bucket
+    //     pooled:  data is copied into slab pools (one per lock stripe) and released in bulk on clear()
+    enum class Storage {
+        pointer,
+        value,
+        pooled
+    };
+    
     template<typename First, typename Second>
     struct pair {
-        static_assert(static_cast<bool>(std::is_trivially_copyable_v<First>), "multh::Map: ERROR!\n \tKey_Type requires trvially copying!\n");
-        static_assert(static_cast<bool>(std::is_trivially_copyable_v<Second>), "multh::Map: ERROR!\n \tKey_Type requires trvially copying!\n");
         First first;
         Second second;
         
         pair () = default;
         
-        pair (pair&) = default;
+        pair (const pair&) = default;
+        
+        pair (pair&&) = default;
+        
+        pair& operator= (const pair&) = default;
+        
+        pair& operator= (pair&&) = default;
+        
+        pair (First first, Second second) : first(std::move(first)), second(std::move(second)) {}
+    };
+    
+    // slab allocator for objects of type T
+    //     objects are placed in slabs of Slab_Size slots, freed slots are chained in a free list
+    //     not thread safe on its own, the Map guards every pool with one of its bucket mutexes
+    template<typename T, size_t Slab_Size = 256>
+    class Pool {
+        union Slot {
+            Slot* next;
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+    public:
+        // all slabs allocated so far
+        std::vector<Slot*> slabs;
+        
+        // head of the list of freed slots
+        Slot* free_list;
+        
+        // number of slots handed out from the newest slab
+        size_t slab_used;
+        
+        Pool () {
+            this->free_list = nullptr;
+            this->slab_used = Slab_Size;
+        }
+        
+        Pool (const Pool&) = delete;
+        
+        Pool (Pool&& other) noexcept : slabs(std::move(other.slabs)) {
+            this->free_list = other.free_list;
+            this->slab_used = other.slab_used;
+            other.free_list = nullptr;
+            other.slab_used = Slab_Size;
+        }
+        
+        ~Pool () {
+            this->release_all();
+        }
+        
+        // construct a new object inside the pool
+        template<typename... Args>
+        T* create (Args&&... args) {
+            Slot* slot = this->take();
+            return new (slot->storage) T(std::forward<Args>(args)...);
+        }
+        
+        // destroy the object and give its slot back to the free list
+        void destroy (T* obj) {
+            obj->~T();
+            Slot* slot = reinterpret_cast<Slot*>(obj);
+            slot->next = this->free_list;
+            this->free_list = slot;
+        }
+        
+        // free all slabs at once
+        //!!! the objects inside must be destroyed before (or be trivially destructible) !!!
+        void release_all () {
+            for (Slot* slab : this->slabs)
+                delete[] slab;
+            
+            this->slabs.clear();
+            this->free_list = nullptr;
+            this->slab_used = Slab_Size;
+        }
+    
+    private:
+        // get an unused slot (from the free list or from the newest slab)
+        Slot* take () {
+            if (this->free_list) {
+                Slot* slot = this->free_list;
+                this->free_list = slot->next;
+                return slot;
+            }
+            
+            if (this->slab_used == Slab_Size) {
+                this->slabs.push_back(new Slot[Slab_Size]);
+                this->slab_used = 0;
+            }
+            return this->slabs.back() + this->slab_used++;
+        }
+    };
+    
+    // read only view of a whole file, memory mapped if possible
+    class Mapped_File {
+    public:
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+        
+        Mapped_File () = default;
+        
+        Mapped_File (const Mapped_File&) = delete;
+        
+        Mapped_File (Mapped_File&& other) noexcept {
+            *this = std::move(other);
+        }
+        
+        Mapped_File& operator= (Mapped_File&& other) noexcept {
+            if (this != &other) {
+                this->close();
+                this->data = other.data;
+                this->size = other.size;
+                other.data = nullptr;
+                other.size = 0;
+            }
+            return *this;
+        }
+        
+        ~Mapped_File () {
+            this->close();
+        }
+        
+        // returns false if the file could not be opened (or is empty)
+        bool open (const std::string& path) {
+            this->close();
+#ifdef MULTH_MAP_MMAP
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            
+            struct stat info;
+            if (::fstat(fd, &info) != 0 || info.st_size <= 0) {
+                ::close(fd);
+                return false;
+            }
+            
+            void* ptr = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd); // the mapping stays valid without the descriptor
+            
+            if (ptr == MAP_FAILED)
+                return false;
+            
+            this->data = static_cast<const unsigned char*>(ptr);
+            this->size = static_cast<size_t>(info.st_size);
+            return true;
+#else
+            std::FILE* file = std::fopen(path.c_str(), "rb");
+            if (!file)
+                return false;
+            
+            std::fseek(file, 0, SEEK_END);
+            const long file_size = std::ftell(file);
+            std::fseek(file, 0, SEEK_SET);
+            
+            if (file_size <= 0) {
+                std::fclose(file);
+                return false;
+            }
+            
+            unsigned char* buffer = new unsigned char[file_size];
+            if (std::fread(buffer, 1, file_size, file) != static_cast<size_t>(file_size)) {
+                delete[] buffer;
+                std::fclose(file);
+                return false;
+            }
+            std::fclose(file);
+            
+            this->data = buffer;
+            this->size = static_cast<size_t>(file_size);
+            return true;
+#endif
+        }
+        
+        void close () {
+            if (!this->data)
+                return;
+#ifdef MULTH_MAP_MMAP
+            ::munmap(const_cast<unsigned char*>(this->data), this->size);
+#else
+            delete[] this->data;
+#endif
+            this->data = nullptr;
+            this->size = 0;
+        }
+    };
+    
+    // start of a file written by Map::save
+    //     followed by bucket_count + 1 element offsets (uint64_t) and the elements of all buckets in bucket order
+    struct Map_Image_Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t element_size;
+        uint32_t key_size;
+        uint32_t data_size;
+        uint64_t bucket_count;
+        uint64_t element_count;
+    };
+
+#ifdef MULTH_MAP_STATS
+    // lock counters of one bucket mutex (on an own cache line, to not slow down the neighbour stripes)
+    struct alignas(64) Stripe_Stats {
+        std::atomic<uint64_t> acquisitions = 0;
+        std::atomic<uint64_t> contended = 0;
+        std::atomic<uint64_t> wait_ns = 0;
+    };
+    
+    // counters of a Map, updated while the map is used
+    //     the histograms count lengths in power of two bins: bin 0 = 0, bin 1 = 1, bin 2 = 2..3, bin 3 = 4..7, ...
+    struct Map_Stats {
+        static constexpr size_t bins = 16;
+        
+        // number of elements compared per lookup (get, get_copy, insert, erease)
+        std::atomic<uint64_t> probe_length[bins] = {};
+        
+        // number of buckets per bucket size
+        std::atomic<uint64_t> chain_length[bins] = {};
+        
+        // number of buckets per unused element slots (capacity - size)
+        std::atomic<uint64_t> slack[bins] = {};
+        
+        // element slots of all buckets (borrowed elements of a loaded image count by their number)
+        std::atomic<uint64_t> capacity = 0;
+        
+        // buckets that still borrow their elements from a loaded image
+        std::atomic<uint64_t> borrowed_buckets = 0;
+        
+        // waiting for rehash_mtx (shared) and number of rehashes
+        std::atomic<uint64_t> rehash_lock_contended = 0;
+        std::atomic<uint64_t> rehash_lock_wait_ns = 0;
+        std::atomic<uint64_t> rehashes = 0;
+        
+        std::vector<Stripe_Stats> stripes;
+        
+        static inline size_t bin (size_t length) {
+            size_t res = 0;
+            while (length > 0 && res < bins - 1) {
+                length >>= 1;
+                res++;
+            }
+            return res;
+        }
+    };
+    
+    // plain copy of the Map_Stats, taken by Map::stats
+    struct Map_Stats_Snapshot {
+        uint64_t probe_length[Map_Stats::bins];
+        uint64_t chain_length[Map_Stats::bins];
+        uint64_t slack[Map_Stats::bins];
+        
+        size_t bucket_count;
+        size_t element_count;
+        uint64_t capacity;
+        uint64_t borrowed_buckets;
+        double load_factor;
+        
+        uint64_t rehash_lock_contended;
+        uint64_t rehash_lock_wait_ns;
+        uint64_t rehashes;
+        
+        struct Stripe {
+            uint64_t acquisitions;
+            uint64_t contended;
+            uint64_t wait_ns;
+        };
+        std::vector<Stripe> stripes;
+    };
+#endif
+    
+    // hash for string keys that also accepts std::string_view and const char* without building a std::string
+    //     gives the same values as std::hash<std::string>
+    struct String_Hash {
+        using is_transparent = void;
+        
+        size_t operator() (std::string_view str) const {
+            return std::hash<std::string_view>()(str);
+        }
+    };
+    
+    // true if the hash function marks itself as usable with other types than the key (like String_Hash)
+    template<typename Hash_Function, typename = void>
+    struct is_transparent : std::false_type {};
+    
+    template<typename Hash_Function>
+    struct is_transparent<Hash_Function, std::void_t<typename Hash_Function::is_transparent>> : std::true_type {};
+    
+    // type erased reference to a lookup key, compares like the key it points to
+    //     (lets a batch of ereases carry std::string_view, const char*, ... as well as Key_Type)
+    template<typename Key_Type>
+    struct Lookup_Ref {
+        const void* key;
+        bool (*equals) (const Key_Type&, const void*);
+        
+        template<typename Lookup_Type>
+        static Lookup_Ref of (const Lookup_Type& key) {
+            return Lookup_Ref{&key, [](const Key_Type& stored, const void* lookup) -> bool {
+                return stored == *static_cast<const Lookup_Type*>(lookup);
+            }};
+        }
         
-        pair (First first, Second second) {
-            this->first = first;
-            this->second = second;
+        friend bool operator== (const Key_Type& stored, const Lookup_Ref& lookup) {
+            return lookup.equals(stored, lookup.key);
         }
     };
     
-    template<typename Key_Type, typename Data_Type>
+    template<typename Key_Type, typename Value_Type>
     class Bucket {
-        static_assert(static_cast<bool>(std::is_trivially_copyable_v<Key_Type>), "multh::Map: ERROR!\n \tKey_Type requires trvially copying!\n");
-        using Element = pair<Key_Type, Data_Type*>;
     public:
+        struct Element {
+            // full hash of the key, compared before the key itself and reused when rehashing
+            size_t hash;
+            Key_Type first;
+            Value_Type second;
+        };
+        
         // number of valid elements in the list
         size_t size;
         
         // number of elements this bucket can handle without realocation
         size_t capacity;
         
-        // raw c-style array for the data
+        // raw c-style array for the data (only the first *size* elements are constructed)
+        //     a bucket with data but capacity 0 only borrows its elements (from a mapped Map image)
         Element* data;
+
+#ifdef MULTH_MAP_STATS
+        // number of elements compared by the last lookup
+        mutable size_t probes = 0;
+#endif
         
         // initialising without array allocation
         Bucket () {
@@ -56,149 +394,1058 @@ namespace multh {
         
         // initialising with predefined capacity
         Bucket (const size_t cap) {
-            data = new Element[cap];
+            this->data = (cap > 0) ? std::allocator<Element>().allocate(cap) : nullptr;
             this->capacity = cap;
             this->size = 0;
         }
         
+        Bucket (const Bucket&) = delete;
+        
+        Bucket (Bucket&& other) noexcept {
+            this->data = other.data;
+            this->capacity = other.capacity;
+            this->size = other.size;
+            other.data = nullptr;
+            other.capacity = 0;
+            other.size = 0;
+        }
+        
+        ~Bucket () {
+            this->clear();
+            if (this->capacity > 0)
+                std::allocator<Element>().deallocate(this->data, this->capacity);
+        }
+        
+        // let the bucket use *count* elements that it does not own (they are copied on the first modification)
+        //!!! the bucket must be empty and without allocation !!!
+        void borrow (Element* elements, const size_t count) {
+            this->data = elements;
+            this->size = count;
+            this->capacity = 0;
+        }
+        
+        // true if the elements are borrowed from a loaded image
+        inline bool borrowed () const {
+            return this->data && this->capacity == 0;
+        }
+        
+        // copy borrowed elements to an own allocation
+        inline void own () {
+            if (this->borrowed())
+                this->grow();
+        }
+        
         // add a new element to the bucket (with deduplicating)
-        bool add (const Element& new_el) {
-            
-            { // deduplicating work
-                Element* it = this->data;
-                const Element* end = this->data + this->size;
-                
-                while (it != end) { // check that no elements with the same key exists
-                    if (it->first == new_el.first)
-                        return false;
-                    it++;
-                }
-            } // dedup-end
-            
-            // increasing container size
-            this->size++;
+        bool add (const size_t hash, Key_Type key, Value_Type value) {
+            if (this->find(hash, key))
+                return false;
             
-            // check if reallocation of the memory must happen
-            if (this->size > this->capacity) {
-                // increase the capacity linear
-                this->capacity += 2;
-                
-                const Element* old_data = this->data;
-                this->data = new Element[this->capacity];
-                
-                if (old_data) { // if old_data was actually used
-                    std::memcpy(this->data, old_data, this->size * sizeof(Element));
-                    delete[] old_data;
-                }
-            }
+            this->push(hash, std::move(key), std::move(value));
+            return true;
+        }
+        
+        // add a new element to the bucket without checking for duplicates
+        void push (const size_t hash, Key_Type&& key, Value_Type&& value) {
+            // check if reallocation of the memory must happen (or the elements are only borrowed)
+            if (this->size >= this->capacity)
+                this->grow();
             
             // put the element in the last position
-            this->data[this->size - 1] = new_el;
-            return true;
+            new (this->data + this->size) Element{hash, std::move(key), std::move(value)};
+            this->size++;
         }
         
         // remove element associated with the Key from the bucket
-        //     and return the pointer to the removed data (nullptr, if key was not found) for further resource management
-        [[nodiscard]]
-        Data_Type* del (const Key_Type key) {
+        //     and move the removed value into *removed* (for further resource management)
+        //     returns false if the key was not found
+        template<typename Lookup_Type>
+        bool del (const size_t hash, const Lookup_Type& key, Value_Type& removed) {
+            this->own();
             
             // iterate through the list to find 'key'
-            Element* it = this->data;
-            const Element* end = this->data + size;
-            
-            while (it->first != key) {
-                if (it == end)
-                    return nullptr;
-                it++;
-            }
+            Element* it = this->find(hash, key);
+            if (!it)
+                return false;
             
-            // save the data pointer before overwriting the element
-            Data_Type* res = it->second;
+            // save the value before overwriting the element
+            removed = std::move(it->second);
             
             // switch the found element to the end
-            const Element* last = end - 1;
+            Element* last = this->data + this->size - 1;
             if (it != last)
-                *it = *last;
+                *it = std::move(*last);
             
             // tell the bucket to not access the last element anymore
+            last->~Element();
             this->size--;
             
-            return res;
+            return true;
         }
         
-        // get the data pointer to matching key (nullptr if key is not in bucket)
-        Data_Type* get (const Key_Type key) const {
+        // get a pointer to the value stored for the key (nullptr if key is not in bucket)
+        //     the pointer is only valid as long as the bucket is not modified
+        template<typename Lookup_Type>
+        Value_Type* get (const size_t hash, const Lookup_Type& key) {
+            this->own();
+            Element* it = this->find(hash, key);
+            return it ? &it->second : nullptr;
+        }
+        
+        // like get, but only for reading (borrowed elements are not copied)
+        template<typename Lookup_Type>
+        const Value_Type* peek (const size_t hash, const Lookup_Type& key) const {
+            const Element* it = this->find(hash, key);
+            return it ? &it->second : nullptr;
+        }
+        
+        // destroy all elements but keep the allocated capacity
+        void clear () {
+            if constexpr (!std::is_trivially_destructible_v<Element>) {
+                for (size_t i = 0; i < this->size; ++i)
+                    this->data[i].~Element();
+            }
+            this->size = 0;
+            
+            // borrowed elements are not needed anymore
+            if (this->capacity == 0)
+                this->data = nullptr;
+        }
+    
+    private:
+        // keys are only compared if the full hashes are equal
+        template<typename Lookup_Type>
+        Element* find (const size_t hash, const Lookup_Type& key) const {
             Element* it = this->data;
-            const Element* end = this->data + size;
+            const Element* end = this->data + this->size;
             
-            while (it->first != key) {
-                if (it == end)
-                    return nullptr;
+            while (it != end) {
+                if (it->hash == hash && it->first == key) {
+#ifdef MULTH_MAP_STATS
+                    this->probes = static_cast<size_t>(it - this->data) + 1;
+#endif
+                    return it;
+                }
                 it++;
             }
-            return it->second;
+#ifdef MULTH_MAP_STATS
+            this->probes = this->size;
+#endif
+            return nullptr;
+        }
+        
+        void grow () {
+            // increase the capacity geometric, so reallocations get rare in big buckets
+            const size_t used = (this->capacity > this->size) ? this->capacity : this->size;
+            const size_t new_capacity = (used < 2) ? 2 : used * 2;
+            Element* new_data = std::allocator<Element>().allocate(new_capacity);
+            
+            if (this->data) { // if old data was actually used
+                if constexpr (std::is_trivially_copyable_v<Element>) {
+                    std::memcpy(static_cast<void*>(new_data), this->data, this->size * sizeof(Element));
+                } else {
+                    for (size_t i = 0; i < this->size; ++i) {
+                        new (new_data + i) Element(std::move(this->data[i]));
+                        this->data[i].~Element();
+                    }
+                }
+                if (this->capacity > 0) // borrowed elements are not freed
+                    std::allocator<Element>().deallocate(this->data, this->capacity);
+            }
+            
+            this->data = new_data;
+            this->capacity = new_capacity;
         }
     };
     
     
     
-    template<typename Key_Type, typename Data_Type, typename Hash_Function = std::hash<Key_Type>>
+    template<typename Key_Type, typename Data_Type, typename Hash_Function = std::hash<Key_Type>, Storage Mode = Storage::pointer>
     
     class Map {
+        static_assert(Mode != Storage::value || static_cast<bool>(std::is_trivially_copyable_v<Data_Type>), "multh::Map: ERROR!\n \tStorage::value requires a trvially copyable Data_Type!\n");
+        
+        // what the buckets store next to the key
+        using Value_Type = std::conditional_t<Mode == Storage::value, Data_Type, Data_Type*>;
+        
+        // what insert takes (the pointer in pointer mode, otherwise the data that gets copied)
+        using Insert_Type = std::conditional_t<Mode == Storage::pointer, Data_Type*, const Data_Type&>;
+        
+        using Element = typename Bucket<Key_Type, Value_Type>::Element;
+        
+        // what a Batch_Write points to for an insert
+        using Write_Data = std::conditional_t<Mode == Storage::pointer, Data_Type*, const Data_Type*>;
+    
     public:
         Hash_Function hash_function;
         std::shared_mutex rehash_mtx;
+        
+        // lock stripes, bucket i is guarded by bucket_mutex[i % bucket_mutex.size()]
+        //     the bucket count is always the stripe count times a power of two,
+        //     so an element keeps its stripe (and its pool) when the map is rehashed
         std::vector<std::mutex> bucket_mutex;
-        std::vector<Bucket<Key_Type, Data_Type>> buckets;
         
-        Map () {
-            buckets = std::vector<Bucket<Key_Type, Data_Type>>(8);
-            bucket_mutex = std::vector<std::mutex>(8);
+        // image loaded with load, buckets borrow their elements from it until they are modified
+        //     (declared before the buckets, so it outlives them)
+        Mapped_File image;
+        
+        std::vector<Bucket<Key_Type, Value_Type>> buckets;
+        
+        // one pool per bucket mutex (only used with Storage::pooled)
+        std::vector<Pool<Data_Type>> pools;
+        
+        // number of elements per stripe, each on an own cache line and only written under its stripe lock
+        //     (one shared counter would be written by every insert and erease of every stripe)
+        struct alignas(64) Stripe_Count {
+            std::atomic<size_t> count = 0;
+        };
+        std::vector<Stripe_Count> stripe_counts;
+        
+        // the map doubles its bucket count when it holds more elements per bucket
+        size_t max_load_factor = 2;
+
+#ifdef MULTH_MAP_STATS
+        Map_Stats statistics;
+#endif
+        
+        Map () : Map(8, 8) {}
+        
+        Map (size_t bucket_count, size_t stripe_count = 8) {
+            stripe_count = (stripe_count > 0) ? stripe_count : 1;
+            bucket_count = Map::round_up(bucket_count, stripe_count);
+            
+            buckets = std::vector<Bucket<Key_Type, Value_Type>>(bucket_count);
+            bucket_mutex = std::vector<std::mutex>(stripe_count);
+            stripe_counts = std::vector<Stripe_Count>(stripe_count);
+            
+            if constexpr (Mode == Storage::pooled)
+                pools = std::vector<Pool<Data_Type>>(stripe_count);
+
+#ifdef MULTH_MAP_STATS
+            statistics.stripes = std::vector<Stripe_Stats>(stripe_count);
+            this->recount();
+#endif
+        }
+        
+        ~Map () {
+            this->release_data();
         }
         
         // get the data belonged to *key*
-        inline Data_Type* get (Key_Type key) {
+        //     not available with Storage::value, because the data could be moved while the bucket is unlocked
+        template<typename Lookup_Type = Key_Type>
+        inline Data_Type* get (const Lookup_Type& key) {
+            static_assert(Mode != Storage::value, "multh::Map: ERROR!\n \tget without guard is not possible with Storage::value, use get_copy\n");
             std::unique_lock<std::mutex> tmp_lck = std::unique_lock<std::mutex>();
             return this->get(key, tmp_lck);
         }
         
         // get the data belonged to *key* and keep the bucket locked with the *guard*
-        Data_Type* get (Key_Type key, std::unique_lock<std::mutex>& guard) {
-            size_t hash = hash_function(key);
+        //     with a transparent Hash_Function (like String_Hash) *key* can be of any type that hashes and compares like Key_Type
+        //!!! do not call other methodes of the map while holding the guard !!!
+        template<typename Lookup_Type = Key_Type>
+        inline Data_Type* get (const Lookup_Type& key, std::unique_lock<std::mutex>& guard) {
+            const auto& lookup = Map::lookup_key(key);
+            return this->get_hashed(this->hash_of(lookup), lookup, guard);
+        }
+        
+        // copy the data belonged to *key* into *out*, returns false if the key was not found
+        //     (elements borrowed from a loaded image are read without copying the bucket)
+        template<typename Lookup_Type = Key_Type>
+        inline bool get_copy (const Lookup_Type& key, Data_Type& out) {
+            const auto& lookup = Map::lookup_key(key);
+            return this->get_copy_hashed(this->hash_of(lookup), lookup, out);
+        }
+        
+        // returns true if the pair [key, data] was succesfully added
+        inline bool insert (Key_Type key, Insert_Type data) {
+            const size_t hash = this->hash_of(key);
+            return this->insert_hashed(hash, std::move(key), data);
+        }
+        
+        template<typename Lookup_Type = Key_Type>
+        inline bool erease (const Lookup_Type& key) {
+            const auto& lookup = Map::lookup_key(key);
+            return this->erease_hashed(this->hash_of(lookup), lookup);
+        }
+        
+        // the *_hashed methodes are the same as the ones above, for callers that already know the hash (like Sharded_Map)
+        //!!! *hash* must be hash_of(key) and *key* must be converted with lookup_key !!!
+        template<typename Lookup_Type>
+        Data_Type* get_hashed (const size_t hash, const Lookup_Type& lookup, std::unique_lock<std::mutex>& guard) {
+            auto shared_lock_guard = this->lock_shared();
+            const size_t index = hash % this->buckets.size();
             
-            std::shared_lock<std::shared_mutex> shared_lock_guard(this->rehash_mtx);
-            hash = hash % this->buckets.size();
+            guard = this->lock_stripe(index);
+            [[maybe_unused]] auto tracker = this->track(buckets[index], true);
+            Value_Type* value = buckets[index].get(hash, lookup);
             
-            guard = std::unique_lock(this->bucket_mutex[hash]);
-            return buckets[hash].get(key);
+            if constexpr (Mode == Storage::value)
+                return value;
+            else
+                return value ? *value : nullptr;
         }
         
-        // returns true if the pair [key, data] was succesfully added
-        bool insert (Key_Type key, Data_Type* data) {
-            size_t hash = hash_function(key);
+        template<typename Lookup_Type>
+        bool get_copy_hashed (const size_t hash, const Lookup_Type& lookup, Data_Type& out) {
+            auto shared_lock_guard = this->lock_shared();
+            const size_t index = hash % this->buckets.size();
             
-            std::shared_lock<std::shared_mutex> shared_lock_guard(this->rehash_mtx);
-            hash = hash % this->buckets.size();
+            auto bucket_lock_guard = this->lock_stripe(index);
+            [[maybe_unused]] auto tracker = this->track(buckets[index], true);
+            const Value_Type* value = buckets[index].peek(hash, lookup);
+            
+            if (!value)
+                return false;
+            
+            if constexpr (Mode == Storage::value)
+                out = *value;
+            else
+                out = **value;
+            return true;
+        }
+        
+        inline bool insert_hashed (const size_t hash, Key_Type key, Insert_Type data) {
+            bool contended;
+            return this->insert_hashed(hash, std::move(key), data, contended);
+        }
+        
+        // *contended* is set if another thread held the stripe lock (lets Sharded_Map detect hot shards)
+        bool insert_hashed (const size_t hash, Key_Type key, Insert_Type data, bool& contended) {
+            bool grow = false;
+            bool res;
+            
+            {
+                auto shared_lock_guard = this->lock_shared();
+                const size_t index = hash % this->buckets.size();
+                
+                auto bucket_lock_guard = this->lock_stripe(index, contended);
+                res = this->insert_locked(index, hash, std::move(key), data, grow);
+            }
+            
+            if (grow)
+                this->grow(hash % this->bucket_mutex.size());
+            return res;
+        }
+        
+        template<typename Lookup_Type>
+        inline bool erease_hashed (const size_t hash, const Lookup_Type& lookup) {
+            bool contended;
+            return this->erease_hashed(hash, lookup, contended);
+        }
+        
+        template<typename Lookup_Type>
+        bool erease_hashed (const size_t hash, const Lookup_Type& lookup, bool& contended) {
+            auto shared_lock_guard = this->lock_shared();
+            const size_t index = hash % this->buckets.size();
+            
+            auto bucket_lock_guard = this->lock_stripe(index, contended);
+            return this->erease_locked(index, hash, lookup);
+        }
+        
+        // one write of apply_batch
+        struct Batch_Write {
+            bool erease;
+            
+            // must be hash_of(key)
+            size_t hash;
+            
+            // insert: the key is moved into the map
+            Key_Type* key;
+            Write_Data data;
+            
+            // erease
+            Lookup_Ref<Key_Type> lookup;
+            
+            // set by apply_batch (like the return value of insert / erease)
+            bool result;
+        };
+        
+        // apply *count* writes at once: rehash_mtx is locked once and every stripe only once
+        //     the writes are reordered by stripe, writes on the same stripe keep their order
+        void apply_batch (Batch_Write** writes, const size_t count) {
+            const size_t stripe_count = this->bucket_mutex.size();
+            size_t grow_stripe = stripe_count;
+            
+            if (count == 0)
+                return;
+            
+            // insertion sort: stable and without allocation (a batch holds at most one write per thread)
+            for (size_t i = 1; i < count; ++i) {
+                Batch_Write* write = writes[i];
+                const size_t stripe_nr = write->hash % stripe_count;
+                
+                size_t pos = i;
+                for (; pos > 0 && writes[pos - 1]->hash % stripe_count > stripe_nr; --pos)
+                    writes[pos] = writes[pos - 1];
+                writes[pos] = write;
+            }
+            
+            {
+                auto shared_lock_guard = this->lock_shared();
+                const size_t bucket_count = this->buckets.size();
+                
+                size_t i = 0;
+                while (i < count) {
+                    // the stripe of bucket (hash % bucket_count) is hash % stripe_count, as the bucket count is a multiple of the stripes
+                    const size_t stripe_nr = writes[i]->hash % stripe_count;
+                    auto bucket_lock_guard = this->lock_stripe(stripe_nr);
+                    
+                    for (; i < count && writes[i]->hash % stripe_count == stripe_nr; ++i) {
+                        Batch_Write& write = *writes[i];
+                        const size_t index = write.hash % bucket_count;
+                        
+                        if (write.erease) {
+                            write.result = this->erease_locked(index, write.hash, write.lookup);
+                        } else {
+                            bool grow = false;
+                            
+                            if constexpr (Mode == Storage::pointer)
+                                write.result = this->insert_locked(index, write.hash, std::move(*write.key), write.data, grow);
+                            else
+                                write.result = this->insert_locked(index, write.hash, std::move(*write.key), *write.data, grow);
+                            
+                            if (grow)
+                                grow_stripe = stripe_nr;
+                        }
+                    }
+                }
+            }
+            
+            if (grow_stripe < stripe_count)
+                this->grow(grow_stripe);
+        }
+        
+        // remove all elements (with Storage::pooled all slabs are freed at once)
+        void clear () {
+            std::unique_lock<std::shared_mutex> lock_guard(this->rehash_mtx);
+            this->lock_stripes();
+            
+            this->release_data();
+            for (auto& bucket : this->buckets)
+                bucket.clear();
+            for (auto& stripe_count : this->stripe_counts)
+                stripe_count.count.store(0, std::memory_order_relaxed);
+            this->image.close();
+            this->recount();
+            
+            this->unlock_stripes();
+        }
+        
+        // redistribute the elements on (at least) *bucket_count* buckets
+        //     the stored hashes are reused, Hash_Function is not called again
+        void rehash (size_t bucket_count) {
+            std::unique_lock<std::shared_mutex> lock_guard(this->rehash_mtx);
+            this->rehash_locked(bucket_count);
+        }
+        
+        // call fn(const Key_Type&, Data_Type&) for every element, bucket by bucket
+        //     only the visited bucket is locked while fn runs, so writers are blocked only shortly
+        //     weakly consistent: elements that are in the map during the whole walk are visited exactly once (even if the map grows meanwhile),
+        //     elements inserted or ereased during the walk may or may not be visited
+        //!!! fn must not call methodes of the map !!!
+        template<typename Function>
+        void for_each (Function fn) {
+            this->walk<false>(fn);
+        }
+        
+        // like for_each, but fn(const Key_Type&, const Data_Type&) only reads
+        //     (buckets borrowed from a loaded image are read directly instead of being copied)
+        template<typename Function>
+        void for_each_read (Function fn) {
+            this->walk<true>(fn);
+        }
+        
+        // like for_each, but the buckets are split in chunks that *thread_count* threads (the calling one included) take one after another
+        //     fn is called concurrently and must be thread safe
+        //     if fn throws (on any thread) no more chunks are handed out and the first exception is rethrown after all threads are joined
+        template<typename Function>
+        void parallel_for_each (Function fn, size_t thread_count = std::thread::hardware_concurrency()) {
+            const size_t layout = this->bucket_count();
+            std::atomic<size_t> next_part = 0;
+            
+            std::mutex error_mtx;
+            std::exception_ptr error;
+            
+            auto stop = [layout, &next_part, &error_mtx, &error]() {
+                std::lock_guard<std::mutex> lck(error_mtx);
+                if (!error)
+                    error = std::current_exception();
+                next_part.store(layout);
+            };
+            
+            auto work = [this, layout, &next_part, &fn, &stop]() {
+                try {
+                    size_t part;
+                    while ((part = next_part.fetch_add(Map::parts_per_chunk)) < layout)
+                        this->visit_parts<false>(layout, part, part + Map::parts_per_chunk, fn);
+                } catch (...) {
+                    stop();
+                }
+            };
+            
+            // reserved, so no started thread is lost to a reallocation
+            std::vector<std::thread> threads;
+            threads.reserve((thread_count > 1) ? thread_count - 1 : 0);
+            
+            try {
+                for (size_t i = 1; i < thread_count; ++i)
+                    threads.emplace_back(work);
+            } catch (...) {
+                stop();
+            }
+            
+            work();
             
-            std::unique_lock bucket_lock_guard(this->bucket_mutex[hash]);
-            multh::pair<Key_Type, Data_Type*> new_el(key, data);
-            return buckets[hash].add(new_el);
+            for (auto& thread : threads)
+                thread.join();
+            
+            if (error)
+                std::rethrow_exception(error);
         }
         
-        bool erease (Key_Type key) {
-            size_t hash = hash_function(key);
+        // copy all elements out of the map (weakly consistent like for_each)
+        std::vector<multh::pair<Key_Type, Data_Type>> snapshot () {
+            std::vector<multh::pair<Key_Type, Data_Type>> res;
+            res.reserve(this->size());
+            
+            this->for_each_read([&res](const Key_Type& key, const Data_Type& data) {
+                res.emplace_back(key, data);
+            });
+            return res;
+        }
+        
+        // write the map to *path* as an image that load can map directly
+        //     the file is written next to *path* and renamed, so a loaded image can be overwritten
+        //     the map is locked for the whole write
+        bool save (const std::string& path) {
+            static_assert(Mode == Storage::value && static_cast<bool>(std::is_trivially_copyable_v<Key_Type>), "multh::Map: ERROR!\n \tsave requires Storage::value and a trvially copyable Key_Type!\n");
+            
+            std::unique_lock<std::shared_mutex> lock_guard(this->rehash_mtx);
+            this->lock_stripes();
+            
+            const bool res = this->save_locked(path);
+            
+            this->unlock_stripes();
+            return res;
+        }
+        
+        // replace the content of the map with an image written by save
+        //     the file is memory mapped and lookups read the mapped elements directly,
+        //     a bucket is copied to the heap the first time it is modified (or handed out for writing)
+        //     returns false (and leaves the map untouched) if the file does not fit to this map
+        bool load (const std::string& path) {
+            static_assert(Mode == Storage::value && static_cast<bool>(std::is_trivially_copyable_v<Key_Type>), "multh::Map: ERROR!\n \tload requires Storage::value and a trvially copyable Key_Type!\n");
+            
+            Mapped_File file;
+            if (!file.open(path) || file.size < sizeof(Map_Image_Header))
+                return false;
             
+            Map_Image_Header header;
+            std::memcpy(&header, file.data, sizeof(Map_Image_Header));
+            
+            if (std::memcmp(header.magic, "MULTHMAP", 8) != 0 || header.version != 2
+                || header.element_size != sizeof(Element) || header.key_size != sizeof(Key_Type) || header.data_size != sizeof(Data_Type))
+                return false;
+            
+            // the counts must fit into the file before anything is calculated with them
+            if (header.bucket_count >= (file.size - sizeof(Map_Image_Header)) / sizeof(uint64_t)
+                || header.element_count > file.size / sizeof(Element))
+                return false;
+            
+            // the bucket layout must fit to the own lock stripes
+            const size_t bucket_count = static_cast<size_t>(header.bucket_count);
+            if (bucket_count == 0 || bucket_count != Map::round_up(bucket_count, this->bucket_mutex.size()))
+                return false;
+            
+            const size_t elements_pos = Map::image_elements_pos(bucket_count);
+            if (file.size != elements_pos + header.element_count * sizeof(Element))
+                return false;
+            
+            const uint64_t* offsets = reinterpret_cast<const uint64_t*>(file.data + sizeof(Map_Image_Header));
+            for (size_t i = 0; i < bucket_count; ++i) {
+                if (offsets[i] > offsets[i + 1])
+                    return false;
+            }
+            if (offsets[0] != 0 || offsets[bucket_count] != header.element_count)
+                return false;
+            
+            std::unique_lock<std::shared_mutex> lock_guard(this->rehash_mtx);
+            this->lock_stripes();
+            
+            this->release_data();
+            this->buckets = std::vector<Bucket<Key_Type, Value_Type>>(bucket_count);
+            
+            Element* elements = reinterpret_cast<Element*>(const_cast<unsigned char*>(file.data + elements_pos));
+            for (size_t i = 0; i < bucket_count; ++i)
+                this->buckets[i].borrow(elements + offsets[i], static_cast<size_t>(offsets[i + 1] - offsets[i]));
+            
+            for (auto& stripe_count : this->stripe_counts)
+                stripe_count.count.store(0, std::memory_order_relaxed);
+            for (size_t i = 0; i < bucket_count; ++i)
+                this->stripe_counts[i % this->stripe_counts.size()].count.fetch_add(this->buckets[i].size, std::memory_order_relaxed);
+            this->image = std::move(file);
+            this->recount();
+            
+            this->unlock_stripes();
+            return true;
+        }
+        
+        // the hash the map stores and selects buckets and stripes with
+        template<typename Lookup_Type>
+        inline size_t hash_of (const Lookup_Type& lookup) {
+            return Map::mix_hash(hash_function(lookup));
+        }
+        
+        // spread all bits of a hash over the low bits, which pick the bucket
+        //     (std::hash of integers and pointers is the identity, so strided keys would share their low bits)
+        static inline size_t mix_hash (const size_t hash) {
+            const uint64_t mixed = static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull;
+            return static_cast<size_t>(mixed ^ (mixed >> 32));
+        }
+        
+        // without a transparent Hash_Function every lookup is converted to Key_Type first
+        template<typename Lookup_Type>
+        static decltype(auto) lookup_key (const Lookup_Type& key) {
+            if constexpr (is_transparent<Hash_Function>::value || std::is_same_v<Lookup_Type, Key_Type>)
+                return (key);
+            else
+                return Key_Type(key);
+        }
+        
+        // number of elements in the map (sum of all stripes)
+        size_t size () const {
+            size_t res = 0;
+            for (auto& stripe_count : this->stripe_counts)
+                res += stripe_count.count.load(std::memory_order_relaxed);
+            return res;
+        }
+        
+        size_t bucket_count () {
             std::shared_lock<std::shared_mutex> shared_lock_guard(this->rehash_mtx);
-            hash = hash % this->buckets.size();
+            return this->buckets.size();
+        }
+
+#ifdef MULTH_MAP_STATS
+        // copy the current statistics (only reads counters, no bucket is visited)
+        Map_Stats_Snapshot stats () {
+            Map_Stats_Snapshot res;
+            
+            for (size_t i = 0; i < Map_Stats::bins; ++i) {
+                res.probe_length[i] = this->statistics.probe_length[i].load(std::memory_order_relaxed);
+                res.chain_length[i] = this->statistics.chain_length[i].load(std::memory_order_relaxed);
+                res.slack[i] = this->statistics.slack[i].load(std::memory_order_relaxed);
+            }
+            
+            res.bucket_count = this->bucket_count();
+            res.element_count = this->size();
+            res.capacity = this->statistics.capacity.load(std::memory_order_relaxed);
+            res.borrowed_buckets = this->statistics.borrowed_buckets.load(std::memory_order_relaxed);
+            res.load_factor = static_cast<double>(res.element_count) / static_cast<double>(res.bucket_count);
+            
+            res.rehash_lock_contended = this->statistics.rehash_lock_contended.load(std::memory_order_relaxed);
+            res.rehash_lock_wait_ns = this->statistics.rehash_lock_wait_ns.load(std::memory_order_relaxed);
+            res.rehashes = this->statistics.rehashes.load(std::memory_order_relaxed);
+            
+            for (auto& stripe : this->statistics.stripes) {
+                res.stripes.push_back({
+                    stripe.acquisitions.load(std::memory_order_relaxed),
+                    stripe.contended.load(std::memory_order_relaxed),
+                    stripe.wait_ns.load(std::memory_order_relaxed)
+                });
+            }
+            return res;
+        }
+#endif
+    
+    private:
+        // number of parts a walk locks rehash_mtx for at once
+        static constexpr size_t parts_per_chunk = 64;
+        
+        // the bucket count is always stripe_count * 2^n
+        //     so of two layouts one is a multiple of the other (needed by visit_parts)
+        static size_t round_up (const size_t bucket_count, const size_t stripe_count) {
+            size_t rounded = stripe_count;
+            while (rounded < bucket_count) {
+                // stop before the doubling overflows (the result is smaller than bucket_count then)
+                if (rounded > std::numeric_limits<size_t>::max() / 2)
+                    break;
+                rounded *= 2;
+            }
+            return rounded;
+        }
+        
+        inline std::mutex& stripe (const size_t index) {
+            return this->bucket_mutex[index % this->bucket_mutex.size()];
+        }
+        
+        // lock the stripe of bucket *index* (and count the waiting time with MULTH_MAP_STATS)
+        inline std::unique_lock<std::mutex> lock_stripe (const size_t index) {
+#ifdef MULTH_MAP_STATS
+            bool contended;
+            return this->lock_stripe(index, contended);
+#else
+            return std::unique_lock<std::mutex>(this->stripe(index));
+#endif
+        }
+        
+        // like above, *contended* is set if another thread held the stripe
+        inline std::unique_lock<std::mutex> lock_stripe (const size_t index, bool& contended) {
+#ifdef MULTH_MAP_STATS
+            Stripe_Stats& stripe_stats = this->statistics.stripes[index % this->bucket_mutex.size()];
+            stripe_stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+#endif
+            
+            std::unique_lock<std::mutex> lck(this->stripe(index), std::try_to_lock);
+            contended = !lck.owns_lock();
+            
+            if (contended) {
+#ifdef MULTH_MAP_STATS
+                const auto start = std::chrono::steady_clock::now();
+                lck.lock();
+                const auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+                
+                stripe_stats.contended.fetch_add(1, std::memory_order_relaxed);
+                stripe_stats.wait_ns.fetch_add(static_cast<uint64_t>(wait.count()), std::memory_order_relaxed);
+#else
+                lck.lock();
+#endif
+            }
+            return lck;
+        }
+        
+        // lock rehash_mtx shared (and count the waiting time with MULTH_MAP_STATS)
+        inline std::shared_lock<std::shared_mutex> lock_shared () {
+#ifdef MULTH_MAP_STATS
+            std::shared_lock<std::shared_mutex> lck(this->rehash_mtx, std::try_to_lock);
+            if (!lck.owns_lock()) {
+                const auto start = std::chrono::steady_clock::now();
+                lck.lock();
+                const auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+                
+                this->statistics.rehash_lock_contended.fetch_add(1, std::memory_order_relaxed);
+                this->statistics.rehash_lock_wait_ns.fetch_add(static_cast<uint64_t>(wait.count()), std::memory_order_relaxed);
+            }
+            return lck;
+#else
+            return std::shared_lock<std::shared_mutex>(this->rehash_mtx);
+#endif
+        }
+
+#ifdef MULTH_MAP_STATS
+        // element slots of a bucket (a borrowed bucket has no allocation, its elements count by their number)
+        static inline size_t slots_of (const Bucket<Key_Type, Value_Type>& bucket) {
+            return bucket.borrowed() ? bucket.size : bucket.capacity;
+        }
+        
+        // records the probe length and the size and capacity changes of one bucket, while its stripe is locked
+        struct Tracker {
+            Map_Stats& statistics;
+            Bucket<Key_Type, Value_Type>& bucket;
+            const size_t size;
+            const size_t slots;
+            const bool borrowed;
+            const bool lookup;
+            
+            Tracker (Map_Stats& statistics, Bucket<Key_Type, Value_Type>& bucket, const bool lookup)
+                : statistics(statistics), bucket(bucket), size(bucket.size), slots(Map::slots_of(bucket)), borrowed(bucket.borrowed()), lookup(lookup) {
+                bucket.probes = 0;
+            }
+            
+            Tracker (const Tracker&) = delete;
+            
+            ~Tracker () {
+                if (this->lookup)
+                    this->statistics.probe_length[Map_Stats::bin(this->bucket.probes)].fetch_add(1, std::memory_order_relaxed);
+                
+                if (this->bucket.size != this->size) {
+                    this->statistics.chain_length[Map_Stats::bin(this->size)].fetch_sub(1, std::memory_order_relaxed);
+                    this->statistics.chain_length[Map_Stats::bin(this->bucket.size)].fetch_add(1, std::memory_order_relaxed);
+                }
+                
+                const size_t slots = Map::slots_of(this->bucket);
+                if (this->bucket.size != this->size || slots != this->slots) {
+                    this->statistics.slack[Map_Stats::bin(this->slots - this->size)].fetch_sub(1, std::memory_order_relaxed);
+                    this->statistics.slack[Map_Stats::bin(slots - this->bucket.size)].fetch_add(1, std::memory_order_relaxed);
+                    
+                    this->statistics.capacity.fetch_add(slots, std::memory_order_relaxed);
+                    this->statistics.capacity.fetch_sub(this->slots, std::memory_order_relaxed);
+                }
+                
+                if (this->bucket.borrowed() != this->borrowed) {
+                    if (this->borrowed)
+                        this->statistics.borrowed_buckets.fetch_sub(1, std::memory_order_relaxed);
+                    else
+                        this->statistics.borrowed_buckets.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        };
+        
+        inline Tracker track (Bucket<Key_Type, Value_Type>& bucket, const bool lookup) {
+            return Tracker(this->statistics, bucket, lookup);
+        }
+        
+        // count chain lengths, slack and capacity from scratch (the caller must hold the map exclusively)
+        void recount () {
+            for (auto& count : this->statistics.chain_length)
+                count = 0;
+            for (auto& count : this->statistics.slack)
+                count = 0;
+            
+            uint64_t capacity = 0;
+            uint64_t borrowed_buckets = 0;
+            for (auto& bucket : this->buckets) {
+                const size_t slots = Map::slots_of(bucket);
+                this->statistics.chain_length[Map_Stats::bin(bucket.size)]++;
+                this->statistics.slack[Map_Stats::bin(slots - bucket.size)]++;
+                capacity += slots;
+                borrowed_buckets += bucket.borrowed() ? 1 : 0;
+            }
+            this->statistics.capacity = capacity;
+            this->statistics.borrowed_buckets = borrowed_buckets;
+        }
+#else
+        struct Tracker {};
+        
+        static inline Tracker track (Bucket<Key_Type, Value_Type>&, const bool) {
+            return Tracker();
+        }
+        
+        static inline void recount () {}
+#endif
+        
+        // position of the first element in an image, aligned for Element
+        static size_t image_elements_pos (const size_t bucket_count) {
+            const size_t pos = sizeof(Map_Image_Header) + (bucket_count + 1) * sizeof(uint64_t);
+            return ((pos + alignof(Element) - 1) / alignof(Element)) * alignof(Element);
+        }
+        
+        // the caller must hold the map exclusively
+        bool save_locked (const std::string& path) {
+            const std::string tmp_path = path + ".tmp";
+            std::FILE* file = std::fopen(tmp_path.c_str(), "wb");
+            if (!file)
+                return false;
+            
+            const size_t bucket_count = this->buckets.size();
+            
+            std::vector<uint64_t> offsets(bucket_count + 1);
+            offsets[0] = 0;
+            for (size_t i = 0; i < bucket_count; ++i)
+                offsets[i + 1] = offsets[i] + this->buckets[i].size;
+            
+            Map_Image_Header header;
+            std::memcpy(header.magic, "MULTHMAP", 8);
+            header.version = 2;
+            header.element_size = sizeof(Element);
+            header.key_size = sizeof(Key_Type);
+            header.data_size = sizeof(Data_Type);
+            header.bucket_count = bucket_count;
+            header.element_count = offsets[bucket_count];
+            
+            bool ok = std::fwrite(&header, sizeof(Map_Image_Header), 1, file) == 1;
+            ok = ok && std::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file) == offsets.size();
+            
+            // padding up to the aligned elements
+            const size_t padding = Map::image_elements_pos(bucket_count) - sizeof(Map_Image_Header) - offsets.size() * sizeof(uint64_t);
+            const unsigned char zeros[alignof(Element)] = {};
+            ok = ok && std::fwrite(zeros, 1, padding, file) == padding;
+            
+            for (auto& bucket : this->buckets) {
+                if (bucket.size > 0)
+                    ok = ok && std::fwrite(bucket.data, sizeof(Element), bucket.size, file) == bucket.size;
+            }
+            
+            ok = (std::fclose(file) == 0) && ok;
+            
+            if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+                std::remove(tmp_path.c_str());
+                return false;
+            }
+            return true;
+        }
+        
+        // the data of a stored value
+        static inline Data_Type& data_of (Value_Type& value) {
+            if constexpr (Mode == Storage::value)
+                return value;
+            else
+                return *value;
+        }
+        
+        static inline const Data_Type& data_of (const Value_Type& value) {
+            if constexpr (Mode == Storage::value)
+                return value;
+            else
+                return *value;
+        }
+        
+        template<bool Read_Only, typename Function>
+        void walk (Function& fn) {
+            const size_t layout = this->bucket_count();
+            
+            for (size_t part = 0; part < layout; part += Map::parts_per_chunk)
+                this->visit_parts<Read_Only>(layout, part, part + Map::parts_per_chunk, fn);
+        }
+        
+        // visit the parts [begin, end) of a walk that started with *layout* buckets
+        //     part p are the elements with hash % layout == p
+        //     if the map has grown since, part p is spread over the buckets p, p + layout, p + 2 * layout, ...
+        //     if it has shrunk, part p shares the bucket p % bucket_count with others and is filtered by the stored hash
+        template<bool Read_Only, typename Function>
+        void visit_parts (const size_t layout, const size_t begin, size_t end, Function& fn) {
+            end = (end < layout) ? end : layout;
+            
+            auto shared_lock_guard = this->lock_shared();
+            const size_t count = this->buckets.size();
             
-            std::unique_lock bucket_lock_guard(this->bucket_mutex[hash]);
-            Data_Type* ptr = buckets[hash].del(key);
+            for (size_t part = begin; part < end; ++part) {
+                if (count >= layout) {
+                    for (size_t index = part; index < count; index += layout) {
+                        auto lck = this->lock_stripe(index);
+                        this->visit_bucket<Read_Only>(this->buckets[index], layout, part, false, fn);
+                    }
+                } else {
+                    const size_t index = part % count;
+                    auto lck = this->lock_stripe(index);
+                    this->visit_bucket<Read_Only>(this->buckets[index], layout, part, true, fn);
+                }
+            }
+        }
+        
+        // call fn for the elements of one bucket (with *filter* only for the ones of *part*), the caller holds the stripe lock
+        //     read only walks read borrowed elements of a loaded image directly, others copy the bucket first
+        template<bool Read_Only, typename Function>
+        void visit_bucket (Bucket<Key_Type, Value_Type>& bucket, const size_t layout, const size_t part, const bool filter, Function& fn) {
+            [[maybe_unused]] auto tracker = this->track(bucket, false);
+            
+            if constexpr (Read_Only) {
+                for (size_t i = 0; i < bucket.size; ++i) {
+                    const Element& el = bucket.data[i];
+                    if (!filter || el.hash % layout == part)
+                        fn(el.first, Map::data_of(el.second));
+                }
+            } else {
+                bucket.own();
+                
+                for (size_t i = 0; i < bucket.size; ++i) {
+                    Element& el = bucket.data[i];
+                    if (!filter || el.hash % layout == part)
+                        fn(static_cast<const Key_Type&>(el.first), Map::data_of(el.second));
+                }
+            }
+        }
+        
+        // wait for all guards handed out by get to be released
+        void lock_stripes () {
+            for (auto& mtx : this->bucket_mutex)
+                mtx.lock();
+        }
+        
+        void unlock_stripes () {
+            for (auto& mtx : this->bucket_mutex)
+                mtx.unlock();
+        }
+        
+        // the caller holds the stripe lock of bucket *index* and rehash_mtx shared
+        //     *grow* is set if the stripe went over its load
+        bool insert_locked (const size_t index, const size_t hash, Key_Type&& key, Insert_Type data, bool& grow) {
+            Bucket<Key_Type, Value_Type>& bucket = this->buckets[index];
+            [[maybe_unused]] auto tracker = this->track(bucket, true);
             
-            if (ptr) {
-                delete(ptr);
-                return true;
+            if constexpr (Mode == Storage::pooled) {
+                // the data is copied into the pool only after the key was checked
+                if (bucket.peek(hash, key))
+                    return false;
+                
+                bucket.push(hash, std::move(key), this->pools[index % this->pools.size()].create(data));
             } else {
+                if (!bucket.add(hash, std::move(key), data))
+                    return false;
+            }
+            
+            grow = this->count_element(index, 1);
+            return true;
+        }
+        
+        // the caller holds the stripe lock of bucket *index* and rehash_mtx shared
+        template<typename Lookup_Type>
+        bool erease_locked (const size_t index, const size_t hash, const Lookup_Type& lookup) {
+            [[maybe_unused]] auto tracker = this->track(this->buckets[index], true);
+            Value_Type removed;
+            
+            if (!this->buckets[index].del(hash, lookup, removed))
                 return false;
+            
+            if constexpr (Mode == Storage::pointer)
+                delete(removed);
+            else if constexpr (Mode == Storage::pooled)
+                this->pools[index % this->pools.size()].destroy(removed);
+            
+            this->count_element(index, -1);
+            return true;
+        }
+        
+        // change the element count of the stripe of bucket *index* (the caller holds the stripe lock and rehash_mtx shared)
+        //     returns true if the stripe holds more than its share of buckets * max_load_factor
+        inline bool count_element (const size_t index, const int change) {
+            std::atomic<size_t>& count = this->stripe_counts[index % this->stripe_counts.size()].count;
+            const size_t new_count = count.load(std::memory_order_relaxed) + change;
+            count.store(new_count, std::memory_order_relaxed);
+            
+            return new_count > (this->buckets.size() / this->stripe_counts.size()) * this->max_load_factor;
+        }
+        
+        // double the bucket count if stripe *stripe_nr* is still over its load
+        void grow (const size_t stripe_nr) {
+            std::unique_lock<std::shared_mutex> lock_guard(this->rehash_mtx);
+            
+            // some other thread could have grown the map in the meantime
+            const size_t limit = (this->buckets.size() / this->stripe_counts.size()) * this->max_load_factor;
+            if (this->stripe_counts[stripe_nr].count.load(std::memory_order_relaxed) > limit)
+                this->rehash_locked(this->buckets.size() * 2);
+        }
+        
+        // the caller must hold rehash_mtx exclusively
+        void rehash_locked (size_t bucket_count) {
+            bucket_count = Map::round_up(bucket_count, this->bucket_mutex.size());
+            if (bucket_count == this->buckets.size())
+                return;
+            
+            this->lock_stripes();
+            
+            std::vector<Bucket<Key_Type, Value_Type>> new_buckets(bucket_count);
+            for (auto& bucket : this->buckets) {
+                for (size_t i = 0; i < bucket.size; ++i) {
+                    auto& el = bucket.data[i];
+                    new_buckets[el.hash % bucket_count].push(el.hash, std::move(el.first), std::move(el.second));
+                }
+            }
+            this->buckets = std::move(new_buckets);
+            this->recount();
+
+#ifdef MULTH_MAP_STATS
+            this->statistics.rehashes++;
+#endif
+            
+            this->unlock_stripes();
+        }
+        
+        // free the data of all elements (the caller must hold the map exclusively)
+        void release_data () {
+            if constexpr (Mode == Storage::pointer) {
+                for (auto& bucket : this->buckets)
+                    for (size_t i = 0; i < bucket.size; ++i)
+                        delete(bucket.data[i].second);
+            } else if constexpr (Mode == Storage::pooled) {
+                // only the destructors must run per element, the memory goes back slab by slab
+                if constexpr (!std::is_trivially_destructible_v<Data_Type>) {
+                    for (auto& bucket : this->buckets)
+                        for (size_t i = 0; i < bucket.size; ++i)
+                            bucket.data[i].second->~Data_Type();
+                }
+                
+                for (auto& pool : this->pools)
+                    pool.release_all();
             }
         }
     };
@@ -0,0 +1,270 @@
+#ifndef MULTH_SHARDED_MAP_HG
+#define MULTH_SHARDED_MAP_HG
+
+#include <vector>
+#include <memory>
+#include <utility>
+#include <cstdint>
+
+// multithreading
+#include <mutex>
+#include <atomic>
+#include <thread>
+
+#include "multh_map.hpp"
+
+namespace multh {
+    
+    // front end over independent Maps (shards), routed by the high bits of the hash
+    //     writes (insert, erease) to a cold shard go directly to its Map
+    //     a shard becomes hot when a direct write has to wait for its lock stripe, then every write is flat combined:
+    //     the write is published in a slot and one thread applies all published writes of the shard with Map::apply_batch,
+    //     so hot keys do not bounce their bucket mutex between all threads
+    //     a hot shard cools down again after enough batches with a single write
+    //     reads go directly to the shard
+    template<typename Key_Type, typename Data_Type, typename Hash_Function = std::hash<Key_Type>, Storage Mode = Storage::pointer>
+    
+    class Sharded_Map {
+        using Shard_Map = Map<Key_Type, Data_Type, Hash_Function, Mode>;
+        using Insert_Type = std::conditional_t<Mode == Storage::pointer, Data_Type*, const Data_Type&>;
+        using Batch_Write = typename Shard_Map::Batch_Write;
+        
+        enum Slot_State : uint32_t {
+            slot_free,      // can be claimed by a thread
+            slot_claimed,   // a thread is writing its operation
+            slot_pending,   // waits for a combiner
+            slot_done       // the combiner has written the result
+        };
+        
+        // published write of one thread (the pointers inside stay valid while the thread waits)
+        struct alignas(64) Slot {
+            std::atomic<uint32_t> state = slot_free;
+            Batch_Write write;
+        };
+        
+        struct Shard {
+            Shard_Map map;
+            
+            // held by the thread that applies the published writes
+            std::mutex combiner_mtx;
+            
+            // all writes go through the combiner while the shard is hot
+            std::atomic<bool> hot = false;
+            
+            // batches in a row with a single write (guarded by combiner_mtx)
+            size_t quiet_batches = 0;
+            
+            std::vector<Slot> slots;
+            
+            // the batch the combiner is collecting (guarded by combiner_mtx)
+            std::vector<Slot*> batch_slots;
+            std::vector<Batch_Write*> batch;
+            
+            Shard (size_t bucket_count, size_t stripe_count, size_t slot_count) : map(bucket_count, stripe_count), slots(slot_count) {
+                batch_slots.reserve(slot_count);
+                batch.reserve(slot_count);
+            }
+        };
+    
+    public:
+        Hash_Function hash_function;
+        std::vector<std::unique_ptr<Shard>> shards;
+        
+        // shard = mixed hash >> shard_shift (the Maps use the low bits for their buckets)
+        unsigned int shard_shift;
+        
+        // number of rounds a combiner looks for new writes before it gives the lock away
+        size_t combine_rounds = 4;
+        
+        // a hot shard goes back to direct writes after this many batches in a row with a single write
+        size_t cool_down_batches = 64;
+        
+        // *shard_count* is rounded up to a power of two (default: one shard per core)
+        //     *slot_count* is the number of threads that can publish a write at once per shard,
+        //     more threads fall back to waiting for the combiner lock
+        Sharded_Map (size_t shard_count = std::thread::hardware_concurrency(), size_t stripe_count = 8, size_t slot_count = 64) {
+            size_t count = 1;
+            unsigned int bits = 0;
+            while (count < shard_count) {
+                count *= 2;
+                bits++;
+            }
+            this->shard_shift = 64 - bits;
+            
+            slot_count = (slot_count > 0) ? slot_count : 1;
+            for (size_t i = 0; i < count; ++i)
+                this->shards.push_back(std::make_unique<Shard>(stripe_count, stripe_count, slot_count));
+        }
+        
+        // get the data belonged to *key* (see Map::get)
+        template<typename Lookup_Type = Key_Type>
+        inline Data_Type* get (const Lookup_Type& key) {
+            static_assert(Mode != Storage::value, "multh::Sharded_Map: ERROR!\n \tget without guard is not possible with Storage::value, use get_copy\n");
+            std::unique_lock<std::mutex> tmp_lck = std::unique_lock<std::mutex>();
+            return this->get(key, tmp_lck);
+        }
+        
+        // get the data belonged to *key* and keep the bucket locked with the *guard* (see Map::get)
+        template<typename Lookup_Type = Key_Type>
+        Data_Type* get (const Lookup_Type& key, std::unique_lock<std::mutex>& guard) {
+            const auto& lookup = Shard_Map::lookup_key(key);
+            const size_t hash = Shard_Map::mix_hash(hash_function(lookup));
+            return this->shard(hash).map.get_hashed(hash, lookup, guard);
+        }
+        
+        // copy the data belonged to *key* into *out*, returns false if the key was not found
+        template<typename Lookup_Type = Key_Type>
+        bool get_copy (const Lookup_Type& key, Data_Type& out) {
+            const auto& lookup = Shard_Map::lookup_key(key);
+            const size_t hash = Shard_Map::mix_hash(hash_function(lookup));
+            return this->shard(hash).map.get_copy_hashed(hash, lookup, out);
+        }
+        
+        // returns true if the pair [key, data] was succesfully added
+        bool insert (Key_Type key, Insert_Type data) {
+            const size_t hash = Shard_Map::mix_hash(hash_function(key));
+            Shard& shard = this->shard(hash);
+            
+            if (!shard.hot.load(std::memory_order_relaxed)) {
+                bool contended = false;
+                const bool res = shard.map.insert_hashed(hash, std::move(key), data, contended);
+                
+                if (contended)
+                    shard.hot.store(true, std::memory_order_relaxed);
+                return res;
+            }
+            
+            Batch_Write write = {};
+            write.erease = false;
+            write.hash = hash;
+            write.key = &key;
+            
+            if constexpr (Mode == Storage::pointer)
+                write.data = data;
+            else
+                write.data = &data;
+            
+            return this->combine(shard, write);
+        }
+        
+        // with a transparent Hash_Function (like String_Hash) *key* can be of any type that hashes and compares like Key_Type
+        template<typename Lookup_Type = Key_Type>
+        bool erease (const Lookup_Type& key) {
+            const auto& lookup = Shard_Map::lookup_key(key);
+            const size_t hash = Shard_Map::mix_hash(hash_function(lookup));
+            Shard& shard = this->shard(hash);
+            
+            if (!shard.hot.load(std::memory_order_relaxed)) {
+                bool contended = false;
+                const bool res = shard.map.erease_hashed(hash, lookup, contended);
+                
+                if (contended)
+                    shard.hot.store(true, std::memory_order_relaxed);
+                return res;
+            }
+            
+            Batch_Write write = {};
+            write.erease = true;
+            write.hash = hash;
+            write.lookup = Lookup_Ref<Key_Type>::of(lookup);
+            
+            return this->combine(shard, write);
+        }
+        
+        void clear () {
+            for (auto& shard : this->shards)
+                shard->map.clear();
+        }
+        
+        // number of elements in all shards
+        size_t size () const {
+            size_t res = 0;
+            for (auto& shard : this->shards)
+                res += shard->map.size();
+            return res;
+        }
+    
+    private:
+        inline Shard& shard (const size_t hash) {
+            if (this->shards.size() == 1)
+                return *this->shards[0];
+            
+            // the hash is already mixed (Map::mix_hash), so its high bits are spread as well
+            return *this->shards[static_cast<uint64_t>(hash) >> this->shard_shift];
+        }
+        
+        // index of the calling thread, to pick a slot
+        static size_t thread_index () {
+            static std::atomic<size_t> next_index = 0;
+            thread_local const size_t index = next_index++;
+            return index;
+        }
+        
+        bool combine (Shard& shard, Batch_Write& write) {
+            Slot& slot = shard.slots[Sharded_Map::thread_index() % shard.slots.size()];
+            
+            uint32_t expected = slot_free;
+            if (!slot.state.compare_exchange_strong(expected, slot_claimed)) {
+                // the slot is used by another thread, become the combiner instead
+                std::lock_guard<std::mutex> lck(shard.combiner_mtx);
+                Batch_Write* batch = &write;
+                shard.map.apply_batch(&batch, 1);
+                this->combine_locked(shard);
+                return write.result;
+            }
+            
+            // publish the write
+            slot.write = write;
+            slot.state.store(slot_pending, std::memory_order_release);
+            
+            while (slot.state.load(std::memory_order_acquire) != slot_done) {
+                if (shard.combiner_mtx.try_lock()) {
+                    std::lock_guard<std::mutex> lck(shard.combiner_mtx, std::adopt_lock);
+                    this->combine_locked(shard);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            
+            const bool res = slot.write.result;
+            slot.state.store(slot_free, std::memory_order_release);
+            return res;
+        }
+        
+        // apply all published writes of the shard in batches (the caller holds combiner_mtx)
+        void combine_locked (Shard& shard) {
+            size_t applied = 0;
+            
+            for (size_t round = 0; round < this->combine_rounds; ++round) {
+                shard.batch_slots.clear();
+                shard.batch.clear();
+                
+                for (Slot& slot : shard.slots) {
+                    if (slot.state.load(std::memory_order_acquire) == slot_pending) {
+                        shard.batch_slots.push_back(&slot);
+                        shard.batch.push_back(&slot.write);
+                    }
+                }
+                
+                if (shard.batch.empty())
+                    break;
+                
+                shard.map.apply_batch(shard.batch.data(), shard.batch.size());
+                applied += shard.batch.size();
+                
+                for (Slot* slot : shard.batch_slots)
+                    slot->state.store(slot_done, std::memory_order_release);
+            }
+            
+            // nobody else is writing anymore, go back to direct writes
+            if (applied > 1) {
+                shard.quiet_batches = 0;
+            } else if (++shard.quiet_batches >= this->cool_down_batches) {
+                shard.quiet_batches = 0;
+                shard.hot.store(false, std::memory_order_relaxed);
+            }
+        }
+    };
+}
+
+#endif
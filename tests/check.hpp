@@ -0,0 +1,16 @@
+#ifndef MULTH_TESTS_CHECK_HG
+#define MULTH_TESTS_CHECK_HG
+
+#include <iostream>
+
+// number of failed checks, the tests return 1 if it is not 0
+inline int errors = 0;
+
+inline void check (bool ok, const char* what) {
+    if (!ok) {
+        std::cout << "FAILED: " << what << std::endl;
+        errors++;
+    }
+}
+
+#endif
@@ -0,0 +1,75 @@
+
+#include "multh_map.hpp"
+#include "check.hpp"
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+int main () {
+    { // small data stored directly in the buckets
+        multh::Map<long, double, std::hash<long>, multh::Storage::value> value_map;
+        
+        for (long i = 0; i < 1000; ++i)
+            check(value_map.insert(i, i * 0.5), "value insert");
+        
+        check(!value_map.insert(7, 1.0), "value dedup");
+        
+        double out = 0;
+        check(value_map.get_copy(7, out) && out == 3.5, "value get_copy");
+        
+        {
+            std::unique_lock<std::mutex> guard;
+            double* ptr = value_map.get(8, guard);
+            check(ptr && *ptr == 4.0, "value get with guard");
+            *ptr = 9.0;
+        }
+        check(value_map.get_copy(8, out) && out == 9.0, "value modify through guard");
+        
+        check(value_map.erease(8), "value erease");
+        check(!value_map.get_copy(8, out), "value erased key is gone");
+        check(!value_map.erease(8), "value erease twice");
+        
+        value_map.clear();
+        check(!value_map.get_copy(7, out), "value clear");
+        check(value_map.insert(7, 1.0), "value insert after clear");
+        
+        std::cout << "value storage done\n";
+    }
+    
+    { // bigger data copied into the pools, filled by multiple threads
+        multh::Map<long, std::string, std::hash<long>, multh::Storage::pooled> pooled_map;
+        
+        std::vector<std::thread> threads;
+        for (long t = 0; t < 4; ++t) {
+            threads.push_back(std::thread([&pooled_map, t]() {
+                for (long i = t; i < 40000; i += 4)
+                    pooled_map.insert(i, std::string("element number ") + std::to_string(i));
+            }));
+        }
+        for (auto& thread : threads)
+            thread.join();
+        
+        std::string* str = pooled_map.get(1234);
+        check(str && *str == "element number 1234", "pooled get");
+        
+        for (long i = 0; i < 40000; i += 2)
+            check(pooled_map.erease(i), "pooled erease");
+        
+        check(!pooled_map.get(1234), "pooled erased key is gone");
+        check(pooled_map.get(1235) && *pooled_map.get(1235) == "element number 1235", "pooled remaining key");
+        
+        // freed slots get reused
+        check(pooled_map.insert(1234, std::string("again")), "pooled insert after erease");
+        check(*pooled_map.get(1234) == "again", "pooled reinserted value");
+        
+        pooled_map.clear();
+        check(!pooled_map.get(1235), "pooled clear");
+        
+        std::cout << "pooled storage done\n";
+    }
+    
+    return errors == 0 ? 0 : 1;
+}
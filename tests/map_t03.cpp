@@ -0,0 +1,95 @@
+
+#include "multh_map.hpp"
+#include "check.hpp"
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <atomic>
+
+
+// counts its calls, to see that rehashing reuses the stored hashes
+std::atomic<size_t> hash_calls = 0;
+
+struct Counting_Hash {
+    using is_transparent = void;
+    
+    size_t operator() (std::string_view str) const {
+        hash_calls++;
+        return multh::String_Hash()(str);
+    }
+};
+
+int main () {
+    { // std::string keys with lookup by std::string_view and const char*
+        multh::Map<std::string, int, multh::String_Hash, multh::Storage::value> string_map;
+        
+        check(string_map.insert("alpha", 1), "string insert");
+        check(string_map.insert(std::string("beta"), 2), "string insert moved key");
+        check(!string_map.insert("alpha", 3), "string dedup");
+        
+        int out = 0;
+        check(string_map.get_copy(std::string_view("alpha"), out) && out == 1, "lookup by string_view");
+        check(string_map.get_copy("beta", out) && out == 2, "lookup by const char*");
+        check(string_map.get_copy(std::string("beta"), out) && out == 2, "lookup by std::string");
+        check(!string_map.get_copy("gamma", out), "missing key");
+        
+        check(string_map.erease(std::string_view("alpha")), "erease by string_view");
+        check(!string_map.get_copy("alpha", out), "erased key is gone");
+        
+        std::cout << "string keys done\n";
+    }
+    
+    { // the map grows by itself without hashing the keys again
+        multh::Map<std::string, std::string, Counting_Hash, multh::Storage::pooled> grow_map;
+        const size_t start_buckets = grow_map.buckets.size();
+        
+        for (int i = 0; i < 10000; ++i)
+            grow_map.insert("key" + std::to_string(i), std::string(40, 'a' + i % 26));
+        
+        check(hash_calls == 10000, "one hash per insert");
+        check(grow_map.buckets.size() > start_buckets, "map has grown");
+        check(grow_map.size() == 10000, "element count");
+        
+        grow_map.rehash(grow_map.buckets.size() * 4);
+        check(hash_calls == 10000, "rehash does not call the hash function");
+        
+        bool all_found = true;
+        for (int i = 0; i < 10000; ++i) {
+            std::string* str = grow_map.get("key" + std::to_string(i));
+            all_found &= str && *str == std::string(40, 'a' + i % 26);
+        }
+        check(all_found, "all elements found after rehash");
+        
+        std::cout << "rehash done\n";
+    }
+    
+    { // non transparent hash: lookups are converted to the key type
+        multh::Map<long, long, std::hash<long>, multh::Storage::value> long_map(100);
+        check(long_map.buckets.size() % long_map.bucket_mutex.size() == 0, "bucket count is a multiple of the stripes");
+        
+        check(long_map.insert(5, 50), "long insert");
+        
+        long out = 0;
+        check(long_map.get_copy(5, out) && out == 50, "long lookup with int");
+    }
+    
+    { // strided keys (std::hash<long> is the identity) are spread over all buckets
+        multh::Map<long, long, std::hash<long>, multh::Storage::value> stride_map;
+        
+        for (long i = 0; i < 20000; ++i)
+            stride_map.insert(i * 1024, i);
+        
+        size_t max_chain = 0;
+        for (auto& bucket : stride_map.buckets)
+            max_chain = (bucket.size > max_chain) ? bucket.size : max_chain;
+        
+        check(stride_map.buckets.size() <= 32768, "strided keys do not blow up the bucket count");
+        check(max_chain <= 16, "strided keys give short chains");
+        
+        long out = 0;
+        check(stride_map.get_copy(1024 * 777, out) && out == 777, "strided lookup");
+    }
+    
+    return errors == 0 ? 0 : 1;
+}
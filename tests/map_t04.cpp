@@ -0,0 +1,130 @@
+
+#include "multh_map.hpp"
+#include "check.hpp"
+
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <stdexcept>
+
+
+int main () {
+    const long count = 200000;
+    
+    multh::Map<long, long, std::hash<long>, multh::Storage::value> test_map;
+    for (long i = 0; i < count; ++i)
+        test_map.insert(i, 1);
+    
+    { // sweep while other threads insert (and make the map grow) and read
+        std::vector<std::atomic<int>> seen(count);
+        std::atomic<bool> w = true;
+        
+        std::thread writer([&test_map, &w]() {
+            long i = count;
+            while (w)
+                test_map.insert(i++, 0);
+        });
+        std::thread reader([&test_map, &w]() {
+            long out;
+            while (w)
+                test_map.get_copy(7, out);
+        });
+        
+        test_map.for_each([&seen](const long& key, long&) {
+            if (key < count)
+                seen[key]++;
+        });
+        
+        w = false;
+        writer.join();
+        reader.join();
+        
+        bool exactly_once = true;
+        for (auto& s : seen)
+            exactly_once &= (s == 1);
+        check(exactly_once, "for_each visits every old element exactly once");
+        
+        std::cout << "for_each done\n";
+    }
+    
+    { // parallel sweep modifying the data
+        test_map.parallel_for_each([](const long&, long& data) {
+            data += 1;
+        }, 4);
+        
+        std::atomic<long> sum = 0;
+        test_map.parallel_for_each([&sum](const long& key, long& data) {
+            if (key < count)
+                sum += data;
+        }, 4);
+        check(sum == 2 * count, "parallel_for_each visits every element once");
+        
+        std::cout << "parallel_for_each done\n";
+    }
+    
+    { // an exception in fn stops the walk and reaches the caller after all threads are joined
+        bool caught = false;
+        try {
+            test_map.parallel_for_each([](const long& key, long&) {
+                if (key == 7)
+                    throw std::runtime_error("key 7");
+            }, 4);
+        } catch (const std::runtime_error& e) {
+            caught = std::string(e.what()) == "key 7";
+        }
+        check(caught, "parallel_for_each rethrows the exception of fn");
+        
+        // every thread throws, only one exception arrives
+        caught = false;
+        try {
+            test_map.parallel_for_each([](const long&, long&) {
+                throw std::runtime_error("all");
+            }, 4);
+        } catch (const std::runtime_error&) {
+            caught = true;
+        }
+        check(caught, "parallel_for_each with every thread throwing");
+        
+        // no lock is left behind
+        check(test_map.insert(-1, 0) && test_map.erease(-1), "map usable after an exception");
+        
+        std::cout << "parallel_for_each exception done\n";
+    }
+    
+    { // generic lambdas get the data as Data_Type& and can change it
+        test_map.for_each([](const auto&, auto& data) {
+            data = 5;
+        });
+        test_map.parallel_for_each([](const auto&, auto& data) {
+            data += 1;
+        }, 4);
+        
+        long wrong = 0;
+        test_map.for_each_read([&wrong](const auto&, const auto& data) {
+            if (data != 6)
+                wrong++;
+        });
+        check(wrong == 0, "generic lambdas in for_each and parallel_for_each");
+        
+        std::cout << "generic lambdas done\n";
+    }
+    
+    { // snapshot after shrinking the map
+        test_map.clear();
+        for (long i = 0; i < 1000; ++i)
+            test_map.insert(i, i);
+        test_map.rehash(8);
+        
+        auto snap = test_map.snapshot();
+        long sum = 0;
+        for (auto& el : snap)
+            sum += el.first == el.second ? 1 : 0;
+        check(snap.size() == 1000 && sum == 1000, "snapshot");
+        
+        std::cout << "snapshot done\n";
+    }
+    
+    return errors == 0 ? 0 : 1;
+}
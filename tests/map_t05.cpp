@@ -0,0 +1,127 @@
+
+#include "multh_map.hpp"
+#include "check.hpp"
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+
+struct Record {
+    long a;
+    double b;
+    char tag[8];
+};
+
+// copy the image at *path* to *bad_path* with *value* written at *pos*
+bool corrupt (const char* path, const char* bad_path, size_t pos, uint64_t value) {
+    std::ifstream in(path, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    
+    if (content.size() < pos + sizeof(value))
+        return false;
+    std::memcpy(&content[pos], &value, sizeof(value));
+    
+    std::ofstream out(bad_path, std::ios::binary);
+    out.write(content.data(), content.size());
+    return static_cast<bool>(out);
+}
+
+int main () {
+    const char* path = "./tests/map_t05.img";
+    const long count = 1000000;
+    
+    {
+        multh::Map<long, Record, std::hash<long>, multh::Storage::value> test_map;
+        for (long i = 0; i < count; ++i)
+            test_map.insert(i, Record{i, i * 0.25, "rec"});
+        
+        const auto start = std::chrono::steady_clock::now();
+        check(test_map.save(path), "save");
+        const auto end = std::chrono::steady_clock::now();
+        
+        std::cout << "save " << count << " elements: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms\n";
+    }
+    
+    {
+        multh::Map<long, Record, std::hash<long>, multh::Storage::value> loaded_map;
+        
+        const auto start = std::chrono::steady_clock::now();
+        check(loaded_map.load(path), "load");
+        const auto end = std::chrono::steady_clock::now();
+        
+        std::cout << "load " << count << " elements: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us\n";
+        
+        check(loaded_map.size() == count, "element count after load");
+        
+        // read only sweeps do not copy the borrowed buckets
+        check(loaded_map.snapshot().size() == count, "snapshot of the mapped image");
+        long sum = 0;
+        loaded_map.for_each_read([&sum](const long&, const Record& rec) {
+            sum += rec.a;
+        });
+        check(sum == count * (count - 1) / 2, "for_each_read of the mapped image");
+        
+        size_t owned = 0;
+        for (auto& bucket : loaded_map.buckets)
+            owned += (bucket.capacity > 0) ? 1 : 0;
+        check(owned == 0, "no bucket copied by read only sweeps");
+        
+        bool all_found = true;
+        Record out;
+        for (long i = 0; i < count; i += 7)
+            all_found &= loaded_map.get_copy(i, out) && out.a == i && out.b == i * 0.25;
+        check(all_found, "lookups in the mapped image");
+        
+        // modifications copy the touched buckets
+        check(loaded_map.erease(14), "erease from image");
+        check(!loaded_map.get_copy(14, out), "ereased key is gone");
+        check(loaded_map.insert(count + 1, Record{-1, 0, "new"}), "insert into image");
+        check(!loaded_map.insert(21, Record{-1, 0, "dup"}), "dedup against image");
+        {
+            std::unique_lock<std::mutex> guard;
+            Record* rec = loaded_map.get(28, guard);
+            check(rec && rec->a == 28, "get with guard from image");
+            rec->a = 280;
+        }
+        check(loaded_map.get_copy(28, out) && out.a == 280, "write to copied bucket");
+        
+        // overwrite the mapped file and load it again
+        check(loaded_map.save(path), "save over the loaded image");
+        check(loaded_map.get_copy(35, out) && out.a == 35, "old image still usable");
+        
+        multh::Map<long, Record, std::hash<long>, multh::Storage::value> reloaded_map;
+        check(reloaded_map.load(path), "reload");
+        check(reloaded_map.get_copy(28, out) && out.a == 280 && !reloaded_map.get_copy(14, out), "reloaded content");
+        
+        // growing the map moves everything out of the image
+        reloaded_map.rehash(reloaded_map.bucket_count() * 2);
+        check(reloaded_map.get_copy(count + 1, out) && out.a == -1, "rehash of a loaded map");
+        
+        // images with corrupted counts in the header are rejected (and do not hang or read past the file)
+        const char* bad_path = "./tests/map_t05_bad.img";
+        
+        check(corrupt(path, bad_path, offsetof(multh::Map_Image_Header, bucket_count), (uint64_t(1) << 63) + 1), "write image with huge bucket_count");
+        check(!reloaded_map.load(bad_path), "huge bucket_count is rejected");
+        
+        check(corrupt(path, bad_path, offsetof(multh::Map_Image_Header, element_count), uint64_t(1) << 62), "write image with overflowing element_count");
+        check(!reloaded_map.load(bad_path), "overflowing element_count is rejected");
+        std::remove(bad_path);
+        
+        check(reloaded_map.get_copy(28, out) && out.a == 280, "map unchanged after rejected loads");
+        
+        multh::Map<long, long, std::hash<long>, multh::Storage::value> wrong_map;
+        check(!wrong_map.load(path), "image with other types is rejected");
+        check(!wrong_map.load("./tests/does_not_exist.img"), "missing file");
+        
+        std::cout << "image done\n";
+    }
+    
+    std::remove(path);
+    return errors == 0 ? 0 : 1;
+}
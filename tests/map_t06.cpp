@@ -0,0 +1,95 @@
+
+#define MULTH_MAP_STATS
+#include "multh_map.hpp"
+#include "check.hpp"
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <cstdio>
+
+
+uint64_t sum (const uint64_t* bins) {
+    uint64_t res = 0;
+    for (size_t i = 0; i < multh::Map_Stats::bins; ++i)
+        res += bins[i];
+    return res;
+}
+
+int main () {
+    multh::Map<long, long, std::hash<long>, multh::Storage::value> test_map;
+    
+    // all threads write to the same few keys
+    std::vector<std::thread> threads;
+    for (long t = 0; t < 4; ++t) {
+        threads.push_back(std::thread([&test_map, t]() {
+            for (long i = 0; i < 20000; ++i) {
+                test_map.insert(t * 20000 + i, i);
+                test_map.erease(i % 4);
+                test_map.insert(i % 4, i);
+            }
+        }));
+    }
+    for (auto& thread : threads)
+        thread.join();
+    
+    long out;
+    for (long i = 0; i < 1000; ++i)
+        test_map.get_copy(i, out);
+    
+    multh::Map_Stats_Snapshot stats = test_map.stats();
+    
+    uint64_t acquisitions = 0;
+    uint64_t contended = 0;
+    for (auto& stripe : stats.stripes) {
+        acquisitions += stripe.acquisitions;
+        contended += stripe.contended;
+    }
+    
+    check(stats.stripes.size() == test_map.bucket_mutex.size(), "one entry per stripe");
+    check(acquisitions == 4 * 3 * 20000 + 1000, "every bucket lock is counted");
+    check(sum(stats.probe_length) == acquisitions, "one probe length per lookup");
+    check(sum(stats.chain_length) == stats.bucket_count, "every bucket in the chain histogram");
+    check(stats.rehashes > 0, "rehashes counted");
+    check(sum(stats.slack) == stats.bucket_count, "every bucket in the slack histogram");
+    check(stats.capacity >= stats.element_count, "capacity covers the elements");
+    check(stats.borrowed_buckets == 0, "no borrowed buckets without an image");
+    check(stats.load_factor <= test_map.max_load_factor, "load factor");
+    
+    std::cout << "elements: " << stats.element_count << ", buckets: " << stats.bucket_count << ", capacity: " << stats.capacity << ", load factor: " << stats.load_factor << "\n";
+    std::cout << "bucket locks: " << acquisitions << ", contended: " << contended << ", rehash_mtx contended: " << stats.rehash_lock_contended << "\n";
+    
+    std::cout << "chain length bins:";
+    for (size_t i = 0; i < multh::Map_Stats::bins; ++i)
+        std::cout << " " << stats.chain_length[i];
+    std::cout << "\nslack bins:";
+    for (size_t i = 0; i < multh::Map_Stats::bins; ++i)
+        std::cout << " " << stats.slack[i];
+    std::cout << "\n";
+    
+    { // buckets borrowed from a loaded image count by their elements
+        const char* path = "./tests/map_t06.img";
+        check(test_map.save(path), "save");
+        
+        multh::Map<long, long, std::hash<long>, multh::Storage::value> loaded_map(test_map.bucket_count(), test_map.bucket_mutex.size());
+        check(loaded_map.load(path), "load");
+        
+        multh::Map_Stats_Snapshot loaded = loaded_map.stats();
+        check(loaded.capacity == loaded.element_count, "borrowed capacity equals the element count");
+        check(loaded.borrowed_buckets == loaded.bucket_count, "all buckets borrowed after load");
+        check(loaded.slack[0] == loaded.bucket_count, "borrowed buckets have no slack");
+        
+        // erease copies one bucket to the heap
+        check(loaded_map.erease(100), "erease from image");
+        loaded = loaded_map.stats();
+        check(loaded.borrowed_buckets == loaded.bucket_count - 1, "modified bucket is owned");
+        check(sum(loaded.slack) == loaded.bucket_count, "slack histogram after own");
+        check(loaded.capacity > loaded.element_count, "owned bucket has slack");
+        
+        std::remove(path);
+    }
+    
+    std::cout << "stats done\n";
+    
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+
+#include "multh_sharded_map.hpp"
+#include "check.hpp"
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+
+const long key_count = 10000;
+const long ops_per_thread = 200000;
+const long thread_count = 8;
+
+// zipf distributed keys (a few keys get most of the operations)
+class Zipf {
+public:
+    std::vector<double> cdf;
+    
+    Zipf (long n, double s) {
+        double sum = 0;
+        for (long i = 1; i <= n; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i), s);
+            cdf.push_back(sum);
+        }
+        for (auto& c : cdf)
+            c /= sum;
+    }
+    
+    template<typename Generator>
+    long operator() (Generator& gen) {
+        const double r = std::uniform_real_distribution<double>(0.0, 1.0)(gen);
+        return std::lower_bound(cdf.begin(), cdf.end(), r) - cdf.begin();
+    }
+};
+
+// every thread inserts and ereases skewed keys and counts its successes,
+//     at the end a key is in the map exactly if it was inserted once more than ereased
+template<typename Map_Type>
+double run (Map_Type& map, const char* name, const long threads_used = thread_count) {
+    Zipf zipf(key_count, 1.2);
+    std::vector<std::atomic<long>> balance(key_count);
+    
+    const auto start = std::chrono::steady_clock::now();
+    
+    std::vector<std::thread> threads;
+    for (long t = 0; t < threads_used; ++t) {
+        threads.push_back(std::thread([&map, &zipf, &balance, t]() {
+            std::mt19937_64 gen(t);
+            for (long i = 0; i < ops_per_thread; ++i) {
+                const long key = zipf(gen);
+                if (i % 2 == 0) {
+                    if (map.insert(key, key * 2))
+                        balance[key]++;
+                } else {
+                    if (map.erease(key))
+                        balance[key]--;
+                }
+            }
+        }));
+    }
+    for (auto& thread : threads)
+        thread.join();
+    
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    bool consistent = true;
+    long out;
+    for (long key = 0; key < key_count; ++key) {
+        const bool found = map.get_copy(key, out);
+        consistent &= (balance[key] == (found ? 1 : 0)) && (!found || out == key * 2);
+    }
+    check(consistent, name);
+    
+    const double throughput = threads_used * ops_per_thread / seconds;
+    std::cout << name << ": " << static_cast<long>(throughput) << " ops/s\n";
+    return throughput;
+}
+
+int main () {
+    { // single writer: Sharded_Map writes directly, like Map
+        multh::Map<long, long, std::hash<long>, multh::Storage::value> map;
+        run(map, "Map (1 thread)", 1);
+        
+        multh::Sharded_Map<long, long, std::hash<long>, multh::Storage::value> sharded_map;
+        run(sharded_map, "Sharded_Map (1 thread)", 1);
+    }
+    {
+        multh::Map<long, long, std::hash<long>, multh::Storage::value> map;
+        run(map, "Map");
+    }
+    {
+        multh::Sharded_Map<long, long, std::hash<long>, multh::Storage::value> sharded_map;
+        run(sharded_map, "Sharded_Map");
+    }
+    {
+        // more threads than slots, so some of them have to wait for the combiner lock
+        multh::Sharded_Map<long, long, std::hash<long>, multh::Storage::value> small_map(2, 8, 2);
+        run(small_map, "Sharded_Map (2 shards, 2 slots)");
+        
+        small_map.clear();
+        check(small_map.size() == 0, "clear");
+    }
+    {
+        // every write goes through the combiner (the shards never cool down)
+        multh::Sharded_Map<long, long, std::hash<long>, multh::Storage::value> combined_map(2, 8, 4);
+        combined_map.cool_down_batches = static_cast<size_t>(-1);
+        for (auto& shard : combined_map.shards)
+            shard->hot = true;
+        
+        run(combined_map, "Sharded_Map (always combined)");
+    }
+    {
+        multh::Sharded_Map<long, std::string, std::hash<long>, multh::Storage::pointer> pointer_map(4);
+        check(pointer_map.insert(5, new std::string("hello")), "pointer insert");
+        check(*pointer_map.get(5) == "hello", "pointer get");
+        check(pointer_map.erease(5) && !pointer_map.get(5), "pointer erease");
+    }
+    {
+        // erease without building a std::string for the lookup
+        multh::Sharded_Map<std::string, long, multh::String_Hash, multh::Storage::value> string_map(4);
+        check(string_map.insert("one", 1) && string_map.insert("two", 2), "string insert");
+        check(string_map.erease("one") && !string_map.erease("one"), "string erease with const char*");
+        check(string_map.erease(std::string_view("two")), "string erease with string_view");
+        check(string_map.size() == 0, "string size");
+    }
+    {
+        // without a transparent hash the lookup is converted to the key first
+        multh::Sharded_Map<std::string, long, std::hash<std::string>, multh::Storage::value> plain_map(4);
+        check(plain_map.insert("one", 1) && plain_map.erease("one"), "plain string erease");
+    }
+    
+    return errors == 0 ? 0 : 1;
+}